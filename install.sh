@@ -4,8 +4,59 @@ ARCH=$(uname -m)
 MACHINE=$(uname -o -s -r -m)
 PYVER=$(python3 -V)
 CURRENTWD=$PWD
-FIND_FILE="/etc/sudoers"
-FIND_STR="short_press_gpio420"
+ATX_GPIO=420
+KVMD_PACKAGES="/usr/local/lib/python3.10/kvmd-packages"
+#kvmd补丁，按顺序应用
+KVMD_PATCHES=(
+  "3.198msd.patch"
+  "3.198jpeg-integrity.patch"
+  "3.198vnc-tiles.patch"
+  "3.198vnc-tight-rects.patch"
+  "3.198vnc-h264-chunks.patch"
+  "3.198memsink-fanout.patch"
+  "3.198vnc-adaptive.patch"
+  "3.198streamer-preview.patch"
+  "3.198snapshot-preview.patch"
+  "3.198ocr-pool.patch"
+  "3.198hid-coalesce.patch"
+  "3.198hid-latency.patch"
+  "3.198hid-printer.patch"
+  "3.198msd-writer.patch"
+  "3.198msd-remote-segments.patch"
+  "3.198msd-dedup.patch"
+  "3.198msd-sparse.patch"
+  "3.198msd-compress.patch"
+  "3.198atx-gpiod.patch"
+  "3.198ws-deltas.patch"
+  "3.198startup.patch"
+  "3.198memory-budget.patch"
+  "3.198log-cursor.patch"
+  "3.198ipmi-proxy.patch"
+  "3.198bench.patch"
+  "3.198vnc-tls.patch"
+  "3.198audio.patch"
+  "3.198msd-delta.patch"
+  "3.198memsink-fanout-fix.patch"
+  "3.198snapshot-preview-fix.patch"
+  "3.198ocr-pool-fix.patch"
+  "3.198hid-latency-fix.patch"
+  "3.198hid-printer-fix.patch"
+  "3.198msd-writer-fix.patch"
+  "3.198msd-dedup-fix.patch"
+  "3.198atx-gpiod-fix.patch"
+  "3.198ws-deltas-fix.patch"
+  "3.198memory-budget-fix.patch"
+  "3.198log-cursor-fix.patch"
+  "3.198vnc-tls-fix.patch"
+  "3.198audio-fix.patch"
+  "3.198msd-delta-fix.patch"
+  "3.198vnc-tiles-fix.patch"
+  "3.198vnc-adaptive-fix.patch"
+  "3.198hid-latency-fix2.patch"
+  "3.198msd-dedup-fix2.patch"
+  "3.198ws-deltas-fix2.patch"
+  "3.198memory-budget-fix2.patch"
+)
 
 #检查架构和Python版本
 check-environment(){
@@ -63,8 +114,8 @@ override-uboot(){
 #安装依赖软件
 install-dependencies(){
   bash <(curl -sSL https://gitee.com/SuperManito/LinuxMirrors/raw/main/ChangeMirrors.sh) --source mirrors.tuna.tsinghua.edu.cn --updata-software false --web-protocol http && echo "换源成功！"
-  echo -e "\e[0;32m正在安装依赖软件nginx tesseract-ocr tesseract-ocr-eng janus libevent-dev libgpiod-dev tesseract-ocr-chi-sim......"  
-  apt install -y nginx tesseract-ocr tesseract-ocr-eng janus libevent-dev libgpiod-dev tesseract-ocr-chi-sim  >> ./log.txt
+  echo -e "\e[0;32m正在安装依赖软件nginx tesseract-ocr tesseract-ocr-eng janus libevent-dev libgpiod-dev tesseract-ocr-chi-sim v4l-utils......"  
+  apt install -y nginx tesseract-ocr tesseract-ocr-eng janus libevent-dev libgpiod-dev tesseract-ocr-chi-sim v4l-utils  >> ./log.txt
 }
 
 #安装PiKVM
@@ -74,33 +125,116 @@ install-pikvm(){
   systemctl enable kvmd-vnc
   echo "PiKVM安装成功！"
   cd $CURRENTWD
-  cp -f ./patch/long_press_gpio420 /usr/bin && cp -f ./patch/short_press_gpio420 /usr/bin
-  chmod +x /usr/bin/long_press_gpio420 && chmod +x /usr/bin/short_press_gpio420
-  echo "GPIO-420脚本移动成功！"
   cp -f ./patch/hw.py /usr/local/lib/python3.10/kvmd-packages/kvmd/apps/kvmd/info/
   chmod +x /usr/local/lib/python3.10/kvmd-packages/kvmd/apps/kvmd/info/hw.py
   cp -f ./config/main.yaml /etc/kvmd/ && cp -f ./config/override.yaml /etc/kvmd/ 
   echo "配置文件替换成功！"
+  mkdir -p /var/cache/kvmd/config && chmod 1777 /var/cache/kvmd/config
   kvmd -m >> ./log.txt
 }
 
-#应用补丁
-add-patches(){
-  if [ ! -f `grep -c "$FIND_STR" $FIND_FILE`  ]; then
-    echo kvmd ALL=\(ALL\) NOPASSWD: /usr/bin/long_press_gpio420,/usr/bin/short_press_gpio420 >>  /etc/sudoers
+#检测V4L2 M2M硬件H.264编码器，存在时启用H.264输出（WebRTC/VNC）
+enable-h264(){
+  M2M_DEVICE=""
+  for dev in /dev/video*; do
+    [ -c "$dev" ] || continue
+    if v4l2-ctl -d $dev --all 2>/dev/null | grep -q "Memory-to-Memory" \
+      && v4l2-ctl -d $dev --list-formats 2>/dev/null | grep -q "'H264'"; then
+      M2M_DEVICE=$dev
+      break
+    fi
+  done
+  if [ -n "$M2M_DEVICE" ]; then
+    mkdir -p /etc/kvmd/override.d
+    sed "s#__M2M_DEVICE__#$M2M_DEVICE#" ./config/h264.yaml > /etc/kvmd/override.d/h264.yaml
+    systemctl enable kvmd-janus
+    echo "已启用H.264硬件编码：$M2M_DEVICE"
+  else
+    rm -f /etc/kvmd/override.d/h264.yaml
+    echo "未找到H.264硬件编码器，继续使用MJPEG视频流"
   fi
+}
 
-  if [ ! -f "/usr/local/lib/python3.10/kvmd-packages/3.198msd.patch"  ]; then
-    cd $CURRENTWD
-    cp ./patch/3.198msd.patch /usr/local/lib/python3.10/kvmd-packages/ && cd /usr/local/lib/python3.10/kvmd-packages/
-    patch -s -p0 < 3.198msd.patch
-    echo "MSD补丁应用成功！"
+#将sysfs编号的ATX电源按键GPIO换算为gpiochip和线路偏移，通过libgpiod驱动
+enable-atx(){
+  ATX_DEVICE=""
+  for chip in /sys/class/gpio/gpiochip*; do
+    [ -d "$chip" ] || continue
+    BASE=$(cat $chip/base)
+    NGPIO=$(cat $chip/ngpio)
+    if [ $ATX_GPIO -ge $BASE ] && [ $ATX_GPIO -lt $((BASE + NGPIO)) ]; then
+      ATX_DEVICE=/dev/$(ls $chip/device 2>/dev/null | grep -m1 "^gpiochip")
+      ATX_POWER_PIN=$((ATX_GPIO - BASE))
+      break
+    fi
+  done
+  if [ -c "$ATX_DEVICE" ]; then
+    mkdir -p /etc/kvmd/override.d
+    sed -e "s#__ATX_DEVICE__#$ATX_DEVICE#" -e "s#__ATX_POWER_PIN__#$ATX_POWER_PIN#" ./config/atx.yaml > /etc/kvmd/override.d/atx.yaml
+    echo "已启用ATX电源按键：$ATX_DEVICE 线路 $ATX_POWER_PIN"
+  else
+    rm -f /etc/kvmd/override.d/atx.yaml
+    echo "未找到GPIO-$ATX_GPIO，ATX电源按键不可用"
   fi
+}
+
+#检测带录音PCM的USB声卡（采集卡的UAC音频），存在时由kvmd-audio编码为Opus送入Janus
+enable-audio(){
+  AUDIO_DEVICE=""
+  for card in /proc/asound/card[0-9]*; do
+    [ -f "$card/usbid" ] || continue
+    PCM=$(ls -d $card/pcm*c 2>/dev/null | head -1)
+    if [ -n "$PCM" ]; then
+      AUDIO_DEVICE="plughw:CARD=$(cat $card/id),DEV=$(echo $PCM | sed 's/.*pcm\([0-9]*\)c$/\1/')"
+      break
+    fi
+  done
+  if [ -n "$AUDIO_DEVICE" ]; then
+    apt install -y libopus0 libasound2 >> ./log.txt
+    mkdir -p /etc/kvmd/override.d
+    sed "s#__AUDIO_DEVICE__#$AUDIO_DEVICE#" ./config/audio.yaml > /etc/kvmd/override.d/audio.yaml
+    cp -f ./config/janus.plugin.streaming.jcfg /etc/kvmd/janus/
+    STREAMING_PLUGIN=$(find /usr/lib -name libjanus_streaming.so | head -1)
+    [ -n "$STREAMING_PLUGIN" ] && ln -sf $STREAMING_PLUGIN /usr/lib/ustreamer/janus/
+    cp -f ./config/kvmd-audio.service /usr/lib/systemd/system/
+    systemctl daemon-reload
+    systemctl enable kvmd-audio
+    echo "已启用音频采集：$AUDIO_DEVICE"
+  else
+    rm -f /etc/kvmd/override.d/audio.yaml /etc/kvmd/janus/janus.plugin.streaming.jcfg
+    systemctl disable kvmd-audio 2>/dev/null
+    echo "未找到USB音频采集设备，WebRTC不带声音"
+  fi
+}
+
+#应用补丁
+add-patches(){
+  for KVMD_PATCH in "${KVMD_PATCHES[@]}"; do
+    if [ ! -f "$KVMD_PACKAGES/$KVMD_PATCH"  ]; then
+      cd $CURRENTWD
+      cp ./patch/$KVMD_PATCH $KVMD_PACKAGES/ && cd $KVMD_PACKAGES/
+      patch -s -p0 < $KVMD_PATCH
+      echo "$KVMD_PATCH补丁应用成功！"
+    fi
+  done
+  #kvmd-bench和kvmd-audio由补丁新增，启动脚本按kvmd-ipmi的格式生成
+  sed -e "s/kvmd-ipmi/kvmd-bench/" -e "s/kvmd\.apps\.ipmi/kvmd.apps.bench/" /usr/bin/kvmd-ipmi > /usr/bin/kvmd-bench
+  chmod +x /usr/bin/kvmd-bench
+  sed -e "s/kvmd-ipmi/kvmd-audio/" -e "s/kvmd\.apps\.ipmi/kvmd.apps.audio/" /usr/bin/kvmd-ipmi > /usr/bin/kvmd-audio
+  chmod +x /usr/bin/kvmd-audio
 
   cd $CURRENTWD
   cp -f ./patch/chinese.patch /usr/share/kvmd/web/ && cd /usr/share/kvmd/web/
   patch -s -p0 < chinese.patch
   echo  -e "\e[0;32m中文补丁应用成功！"
+  cd $CURRENTWD
+  cp -f ./patch/web-ws-deltas.patch /usr/share/kvmd/web/ && cd /usr/share/kvmd/web/
+  patch -s -p0 < web-ws-deltas.patch
+  echo "web-ws-deltas.patch补丁应用成功！"
+  cd $CURRENTWD
+  cp -f ./patch/web-janus-audio.patch /usr/share/kvmd/web/ && cd /usr/share/kvmd/web/
+  patch -s -p0 < web-janus-audio.patch
+  echo "web-janus-audio.patch补丁应用成功！"
   apt install -y libjpeg-dev libfreetype6-dev python3-dev python3-pip
   pip3 config set global.index-url https://pypi.tuna.tsinghua.edu.cn/simple/
   pip3 install -U Pillow
@@ -119,6 +253,9 @@ override-uboot
 change-device-tree
 install-dependencies
 install-pikvm
+enable-h264
+enable-atx
+enable-audio
 add-patches
 show-info
 reboot
@@ -21,45 +21,97 @@
 
 
 import os
+import glob
 import asyncio
 
-from typing import Callable
 from typing import AsyncGenerator
-from typing import TypeVar
 
 from ....logging import get_logger
 
 from .... import env
-from .... import tools
 from .... import aiofs
-from .... import aioproc
 
 from .base import BaseInfoSubmanager
 
 
 # =====
-_RetvalT = TypeVar("_RetvalT")
+class _SysfsValue:
+    # Файл открывается один раз, дальше значение перечитывается через pread() с нулевого смещения.
+    # Для sysfs это дешевле open/read/close на каждом тике и не требует треда.
+    def __init__(self, path: str) -> None:
+        self.__path = path
+        self.__fd = -1
+
+    def read_int(self) -> (int | None):
+        try:
+            if self.__fd < 0:
+                self.__fd = os.open(self.__path, os.O_RDONLY | os.O_CLOEXEC)
+            return int(os.pread(self.__fd, 64, 0).strip())
+        except Exception:
+            self.close()
+            return None
+
+    def close(self) -> None:
+        if self.__fd >= 0:
+            try:
+                os.close(self.__fd)
+            except Exception:
+                pass
+            self.__fd = -1
 
 
 # =====
 class HwInfoSubmanager(BaseInfoSubmanager):
+    # На Meson8b нет vcgencmd, поэтому флаги троттлинга собираются из sysfs
+    # в том же формате, что и get_throttled у Raspberry Pi
+    __TEMP_STEP = 1.0  # Градусы, изменение меньше этого не рассылается клиентам
+
     def __init__(
         self,
-        vcgencmd_cmd: list[str],
+        vcgencmd_cmd: list[str],  # Оставлено для совместимости конфига, не используется
         state_poll: float,
     ) -> None:
 
-        self.__vcgencmd_cmd = vcgencmd_cmd
+        _ = vcgencmd_cmd
         self.__state_poll = state_poll
 
         self.__dt_cache: dict[str, str] = {}
 
+        sysfs = f"{env.SYSFS_PREFIX}/sys"
+        self.__temp = _SysfsValue(f"{sysfs}/class/thermal/thermal_zone0/temp")
+        self.__temp_trip = _SysfsValue(f"{sysfs}/class/thermal/thermal_zone0/trip_point_0_temp")
+        self.__freq_max = _SysfsValue(f"{sysfs}/devices/system/cpu/cpu0/cpufreq/scaling_max_freq")
+        self.__freq_limit = _SysfsValue(f"{sysfs}/devices/system/cpu/cpu0/cpufreq/cpuinfo_max_freq")
+        self.__undervoltage = [
+            _SysfsValue(path)
+            for path in sorted(glob.glob(f"{sysfs}/class/hwmon/hwmon*/in*_lcrit_alarm"))
+        ]
+
+        self.__past_flags = 0
+
     async def get_state(self) -> dict:
-        (model, cpu_temp, throttling) = await asyncio.gather(
-            self.__read_dt_file("model"),
-            self.__get_cpu_temp(),
-            self.__get_throttling(),
-        )
+        model = await self.__read_dt_file("model")
+        temp = self.__temp.read_int()
+        return self.__make_state(model, temp, self.__get_throttling(temp))
+
+    async def poll_state(self) -> AsyncGenerator[dict, None]:
+        model = await self.__read_dt_file("model")
+        prev_state: dict = {}
+        prev_temp: (int | None) = None
+        prev_throttling: (dict | None) = None
+        while True:
+            temp = self.__temp.read_int()
+            throttling = self.__get_throttling(temp)
+            if not prev_state or throttling != prev_throttling or self.__is_temp_changed(prev_temp, temp):
+                prev_state = self.__make_state(model, temp, throttling)
+                yield prev_state
+                prev_temp = temp
+                prev_throttling = throttling
+            await asyncio.sleep(self.__state_poll)
+
+    # =====
+
+    def __make_state(self, model: (str | None), temp: (int | None), throttling: dict) -> dict:
         return {
             "platform": {
                 "type": "rpi",
@@ -68,23 +120,12 @@ class HwInfoSubmanager(BaseInfoSubmanager):
             },
             "health": {
                 "temp": {
-                    "cpu": cpu_temp,
+                    "cpu": (temp / 1000 if temp is not None else None),
                 },
                 "throttling": throttling,
             },
         }
 
-    async def poll_state(self) -> AsyncGenerator[dict, None]:
-        prev_state: dict = {}
-        while True:
-            state = await self.get_state()
-            if state != prev_state:
-                yield state
-                prev_state = state
-            await asyncio.sleep(self.__state_poll)
-
-    # =====
-
     async def __read_dt_file(self, name: str) -> (str | None):
         if name not in self.__dt_cache:
             path = os.path.join(f"{env.PROCFS_PREFIX}/proc/device-tree", name)
@@ -95,48 +136,40 @@ class HwInfoSubmanager(BaseInfoSubmanager):
                 return None
         return self.__dt_cache[name]
 
-    async def __get_cpu_temp(self) -> (float | None):
-        temp_path = f"{env.SYSFS_PREFIX}/sys/class/thermal/thermal_zone0/temp"
-        try:
-            return int((await aiofs.read(temp_path)).strip()) / 1000
-        except Exception as err:
-            return None
+    def __is_temp_changed(self, prev: (int | None), temp: (int | None)) -> bool:
+        if prev is None or temp is None:
+            return (prev != temp)
+        return (abs(temp - prev) >= self.__TEMP_STEP * 1000)
+
+    def __get_throttling(self, temp: (int | None)) -> dict:
+        temp_trip = self.__temp_trip.read_int()
+        freq_max = self.__freq_max.read_int()
+        freq_limit = self.__freq_limit.read_int()
+
+        flags = 0
+        if any(value.read_int() for value in self.__undervoltage):
+            flags |= (1 << 0)
+        if freq_max is not None and freq_limit is not None and freq_max < freq_limit:
+            flags |= (1 << 1)
+        if temp is not None and temp_trip is not None and temp >= temp_trip:
+            flags |= (1 << 2)
+        self.__past_flags |= (flags << 16)
+        flags |= self.__past_flags
 
-    async def __get_throttling(self) -> (dict | None):
-        # https://www.raspberrypi.org/forums/viewtopic.php?f=63&t=147781&start=50#p972790
-        flags = await self.__parse_vcgencmd(
-            arg="get_throttled",
-            parser=(lambda text: int(text.split("=")[-1].strip(), 16)),
-        )
-        if flags is not None:
-            return {
-                "raw_flags": flags,
-                "parsed_flags": {
-                    "undervoltage": {
-                        "now": bool(flags & (1 << 0)),
-                        "past": bool(flags & (1 << 16)),
-                    },
-                    "freq_capped": {
-                        "now": bool(flags & (1 << 1)),
-                        "past": bool(flags & (1 << 17)),
-                    },
-                    "throttled": {
-                        "now": bool(flags & (1 << 2)),
-                        "past": bool(flags & (1 << 18)),
-                    },
+        return {
+            "raw_flags": flags,
+            "parsed_flags": {
+                "undervoltage": {
+                    "now": bool(flags & (1 << 0)),
+                    "past": bool(flags & (1 << 16)),
                 },
-            }
-        return None
-
-    async def __parse_vcgencmd(self, arg: str, parser: Callable[[str], _RetvalT]) -> (_RetvalT | None):
-        cmd = [*self.__vcgencmd_cmd, arg]
-        try:
-            text = (await aioproc.read_process(cmd, err_to_null=True))[1]
-        except Exception:
-            get_logger(0).exception("Error while executing: %s", tools.cmdfmt(cmd))
-            return None
-        try:
-            return parser(text)
-        except Exception as err:
-            get_logger(0).error("Can't parse [ %s ] output: %r: %s", tools.cmdfmt(cmd), text, tools.efmt(err))
-            return None
+                "freq_capped": {
+                    "now": bool(flags & (1 << 1)),
+                    "past": bool(flags & (1 << 17)),
+                },
+                "throttled": {
+                    "now": bool(flags & (1 << 2)),
+                    "past": bool(flags & (1 << 18)),
+                },
+            },
+        }